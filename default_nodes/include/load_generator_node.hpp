@@ -0,0 +1,34 @@
+#pragma once
+
+#include "rachel.hpp"
+
+namespace load_generator_node {
+
+/*
+    Message type exchanged between the synthetic workers. The payload is only
+    there to make the messages as large as a real topology would need.
+*/
+struct LoadMessage {
+    rachel::Time stamp;
+    size_t source = 0;
+    rachel::topics::seq_t seq = 0;
+    std::vector<uint8_t> payload;
+};
+
+/*
+    Spawns a configurable number of synthetic worker nodes, connects them in a
+    topic graph and lets them publish and consume messages for a while. At the
+    end, the achieved rates, dropped messages and latency percentiles are
+    reported. Everything is controlled by launch parameters, see
+    docs/load_generator.md
+*/
+class LoadGeneratorNode : public rachel::Node {
+public:
+    using Node::Node;
+    void run(const nlohmann::json& params) override;
+    void set_default_params(nlohmann::json& params) override;
+    size_t extra_threads(const nlohmann::json& params) const override;
+};
+
+extern LoadGeneratorNode load_generator_node;
+}
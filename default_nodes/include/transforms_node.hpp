@@ -2,8 +2,19 @@
 
 #include "rachel.hpp"
 
+#include <eigen3/Eigen/Geometry>
+
 namespace transforms_node {
 
+/*
+    Message type for publishing transforms to the transforms node. The transform maps points in the source frame to the
+    target frame. Any number of drivers can publish these on the topics listed in the `/transforms_node/topics` parameter.
+*/
+struct TransformUpdate {
+    std::string source, target;
+    Eigen::Isometry3d transform;
+};
+
 class TransformsNode : public rachel::Node {
 private:
     int x = 0;
@@ -11,6 +22,7 @@ private:
 public:
     using Node::Node;
     void run(const nlohmann::json& params) override;
+    void set_default_params(nlohmann::json& params) override;
 };
 
 extern TransformsNode transforms_node;
@@ -0,0 +1,338 @@
+#include <load_generator_node.hpp>
+#include <transforms_node.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace load_generator_node {
+
+LoadGeneratorNode load_generator_node("load_generator");
+
+const std::string NUM_NODES_PARAM = load_generator_node.param_name("~/num_nodes");
+const std::string GRAPH_PARAM = load_generator_node.param_name("~/graph");
+const std::string PAYLOAD_BYTES_PARAM = load_generator_node.param_name("~/payload_bytes");
+const std::string PUBLISH_RATE_PARAM = load_generator_node.param_name("~/publish_rate_hz");
+const std::string CALLBACK_COST_PARAM = load_generator_node.param_name("~/callback_cost_us");
+const std::string QUEUE_SIZE_PARAM = load_generator_node.param_name("~/queue_size");
+const std::string DURATION_PARAM = load_generator_node.param_name("~/duration_s");
+const std::string TRANSFORM_EDGES_PARAM = load_generator_node.param_name("~/transform_edges");
+const std::string TRANSFORMS_TOPIC_PARAM = load_generator_node.param_name("~/transforms_topic");
+
+void LoadGeneratorNode::set_default_params(nlohmann::json& params)
+{
+    params[NUM_NODES_PARAM] = 4;
+    params[GRAPH_PARAM] = "chain";
+    params[PAYLOAD_BYTES_PARAM] = 1024;
+    params[PUBLISH_RATE_PARAM] = 100.0;
+    params[CALLBACK_COST_PARAM] = 10.0;
+    params[QUEUE_SIZE_PARAM] = 4;
+    params[DURATION_PARAM] = 10.0;
+    params[TRANSFORM_EDGES_PARAM] = 5;
+    params[TRANSFORMS_TOPIC_PARAM] = "/transforms";
+}
+
+/*
+    Every worker runs in a thread of its own, while the node's own thread only waits for them
+*/
+size_t LoadGeneratorNode::extra_threads(const nlohmann::json& params) const
+{
+    const size_t num_nodes = params[NUM_NODES_PARAM];
+    return num_nodes > 0 ? num_nodes - 1 : 0;
+}
+
+/*
+    Latencies are counted in logarithmic buckets, so that memory use stays the same however long the load generator
+    runs. Percentiles are accurate to within a few percent.
+*/
+class LatencyHistogram {
+private:
+    static constexpr double min_latency = 1e-7;
+    static constexpr size_t buckets_per_decade = 64;
+    static constexpr size_t num_decades = 9;
+
+    std::array<size_t, buckets_per_decade * num_decades> counts {};
+    size_t total = 0;
+    double max = 0.0;
+
+public:
+    void add(double latency)
+    {
+        const double decades = std::log10(std::max(latency, min_latency) / min_latency);
+        const size_t i = static_cast<size_t>(decades * buckets_per_decade);
+        ++counts[std::min(i, counts.size() - 1)];
+        ++total;
+        max = std::max(max, latency);
+    }
+
+    void merge(const LatencyHistogram& other)
+    {
+        for (size_t i = 0; i < counts.size(); ++i) {
+            counts[i] += other.counts[i];
+        }
+        total += other.total;
+        max = std::max(max, other.max);
+    }
+
+    /*
+        Upper bound of the bucket holding the given percentile, never more than the largest latency seen
+    */
+    double percentile(double p) const
+    {
+        if (total == 0) {
+            return 0.0;
+        }
+
+        const size_t rank = static_cast<size_t>(p * (total - 1) + 0.5);
+        size_t seen = 0;
+        for (size_t i = 0; i < counts.size(); ++i) {
+            seen += counts[i];
+            if (seen > rank) {
+                return std::min(max, min_latency * std::pow(10.0, double(i + 1) / buckets_per_decade));
+            }
+        }
+        return max;
+    }
+};
+
+struct WorkerStats {
+    size_t published = 0;
+    size_t received = 0;
+    size_t dropped = 0;
+    LatencyHistogram latencies;
+};
+
+/*
+    One synthetic node in the generated topology. It publishes on its own topic
+    at a fixed rate and burns a fixed amount of CPU time for every received
+    message.
+*/
+class LoadWorker : public rachel::Node {
+private:
+    size_t index;
+    std::vector<size_t> sources;
+    std::vector<rachel::topics::seq_t> last_seq;
+    rachel::TimeDelta callback_cost;
+
+    rachel::topics::topic_ptr<transforms_node::TransformUpdate> transforms_topic;
+    std::vector<transforms_node::TransformUpdate> transform_updates;
+
+public:
+    WorkerStats stats;
+
+    LoadWorker(const std::string& name, size_t index, const std::vector<size_t>& sources, size_t num_nodes,
+        rachel::TimeDelta callback_cost)
+        : Node(name)
+        , index(index)
+        , sources(sources)
+        , last_seq(num_nodes, 0)
+        , callback_cost(callback_cost)
+    {
+    }
+
+    void on_message(const LoadMessage& msg)
+    {
+        const auto now = rachel::current_time();
+        stats.latencies.add(rachel::to_seconds(now - msg.stamp));
+        ++stats.received;
+
+        // Any gap means the topic queue overflowed before we got to read it.
+        // Sequence numbers start at 1, so 0 means this is the first message
+        // from the source, and whatever was published before we started
+        // reading does not count as dropped
+        auto& last = last_seq[msg.source];
+        if (last > 0 && msg.seq > last + 1) {
+            stats.dropped += msg.seq - last - 1;
+        }
+        last = std::max(last, msg.seq);
+
+        const auto until = now + callback_cost;
+        while (rachel::current_time() < until) { }
+    }
+
+    /*
+        Makes the worker publish updates of its own edges to the transforms node every cycle, instead of messages on
+        its own topic. Frame names are long enough to not fit in the small string buffer, like real ones.
+    */
+    void publish_transforms(const std::string& topic, size_t num_edges)
+    {
+        transforms_topic = rachel::topics::register_publisher<transforms_node::TransformUpdate>(topic);
+        for (size_t k = 0; k < num_edges; ++k) {
+            std::stringstream ss;
+            ss << node_name << "/frame_" << k;
+
+            transforms_node::TransformUpdate update;
+            update.source = ss.str();
+            update.target = load_generator_node.node_name + "/base";
+            update.transform.setIdentity();
+            transform_updates.push_back(update);
+        }
+    }
+
+    void work(const std::vector<rachel::topics::topic_ptr<LoadMessage>>& topics, size_t payload_bytes,
+        rachel::Time end_time, bool run_forever)
+    {
+        for (size_t source : sources) {
+            subscribe<LoadMessage>(topic_name(source), [this](const LoadMessage& msg) { on_message(msg); });
+        }
+
+        LoadMessage msg;
+        msg.source = index;
+        msg.payload.resize(payload_bytes);
+
+        while (main_loop_condition() && (run_forever || rachel::current_time() < end_time)) {
+            if (transforms_topic) {
+                for (const auto& update : transform_updates) {
+                    transforms_topic->publish(update);
+                }
+                stats.published += transform_updates.size();
+                continue;
+            }
+
+            msg.stamp = rachel::current_time();
+            msg.seq = ++stats.published;
+            topics[index]->publish(msg);
+        }
+    }
+
+    static std::string topic_name(size_t i)
+    {
+        std::stringstream ss;
+        ss << load_generator_node.param_name("~/topic_") << i;
+        return ss.str();
+    }
+};
+
+/*
+    Returns, for each worker, the indices of the workers whose topics it
+    subscribes to. Every worker always publishes on its own topic, except in the
+    transforms graph, where workers only publish to the transforms node.
+*/
+std::vector<std::vector<size_t>> build_graph(const std::string& shape, size_t n)
+{
+    std::vector<std::vector<size_t>> sources(n);
+
+    if (shape == "chain") {
+        for (size_t i = 1; i < n; ++i) {
+            sources[i].push_back(i - 1);
+        }
+    } else if (shape == "fan_out") {
+        for (size_t i = 1; i < n; ++i) {
+            sources[i].push_back(0);
+        }
+    } else if (shape == "fan_in") {
+        for (size_t i = 1; i < n; ++i) {
+            sources[0].push_back(i);
+        }
+    } else if (shape == "mesh") {
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = 0; j < n; ++j) {
+                if (i != j) {
+                    sources[i].push_back(j);
+                }
+            }
+        }
+    } else if (shape != "transforms") {
+        std::stringstream ss;
+        ss << "Unknown load generator graph '" << shape
+           << "', expected one of chain, fan_out, fan_in, mesh, transforms";
+        throw std::runtime_error(ss.str());
+    }
+
+    return sources;
+}
+
+void LoadGeneratorNode::run(const nlohmann::json& params)
+{
+    const size_t num_nodes = params[NUM_NODES_PARAM];
+    const std::string graph = params[GRAPH_PARAM];
+    const size_t payload_bytes = params[PAYLOAD_BYTES_PARAM];
+    const double publish_rate = params[PUBLISH_RATE_PARAM];
+    const double callback_cost = params[CALLBACK_COST_PARAM];
+    const size_t queue_size = params[QUEUE_SIZE_PARAM];
+    const double duration = params[DURATION_PARAM];
+    const size_t transform_edges = params[TRANSFORM_EDGES_PARAM];
+    const std::string transforms_topic = params[TRANSFORMS_TOPIC_PARAM];
+
+    if (num_nodes == 0 || publish_rate <= 0.0) {
+        spdlog::warn("load generator has nothing to do, num_nodes = {} and publish_rate_hz = {}", num_nodes,
+            publish_rate);
+        return;
+    }
+
+    const auto sources = build_graph(graph, num_nodes);
+
+    std::vector<rachel::topics::topic_ptr<LoadMessage>> topics;
+    for (size_t i = 0; i < num_nodes; ++i) {
+        topics.push_back(rachel::topics::register_publisher<LoadMessage>(LoadWorker::topic_name(i)));
+        topics.back()->set_queue_size(queue_size);
+    }
+
+    // Workers are kept behind pointers since their subscription callbacks
+    // capture `this`
+    std::vector<std::unique_ptr<LoadWorker>> workers;
+    for (size_t i = 0; i < num_nodes; ++i) {
+        std::stringstream ss;
+        ss << node_name << "/worker_" << i;
+        workers.push_back(std::make_unique<LoadWorker>(ss.str(), i, sources[i], num_nodes,
+            rachel::microseconds(callback_cost)));
+        workers.back()->set_time_delta(rachel::seconds(1.0 / publish_rate));
+        if (graph == "transforms") {
+            workers.back()->publish_transforms(transforms_topic, transform_edges);
+        }
+    }
+
+    if (graph == "transforms") {
+        spdlog::info("load generator starting {} transform drivers, {} edges each at {:.1f} Hz", num_nodes,
+            transform_edges, publish_rate);
+    } else {
+        spdlog::info("load generator starting {} nodes in a {} graph, {} bytes at {:.1f} Hz, {:.1f} us per callback",
+            num_nodes, graph, payload_bytes, publish_rate, callback_cost);
+    }
+
+    const auto start_time = rachel::current_time();
+    const auto end_time = start_time + rachel::seconds(duration);
+    const bool run_forever = duration <= 0.0;
+
+    std::vector<std::thread> threads;
+    for (auto& worker : workers) {
+        LoadWorker* w = worker.get();
+        threads.push_back(std::thread([w, &topics, payload_bytes, end_time, run_forever]() {
+            w->work(topics, payload_bytes, end_time, run_forever);
+        }));
+    }
+
+    for (auto& t : threads) {
+        t.join();
+    }
+
+    const double elapsed = rachel::to_seconds(rachel::current_time() - start_time);
+
+    WorkerStats total;
+    for (const auto& worker : workers) {
+        const WorkerStats& s = worker->stats;
+        spdlog::debug("{} published {}, received {}, dropped {}", worker->node_name, s.published, s.received,
+            s.dropped);
+
+        total.published += s.published;
+        total.received += s.received;
+        total.dropped += s.dropped;
+        total.latencies.merge(s.latencies);
+    }
+
+    if (graph == "transforms") {
+        // The transforms node reports how many of these it received and applied
+        spdlog::info("load generator ran for {:.2f} s: published {} transform updates on {} ({:.0f} updates/s)",
+            elapsed, total.published, transforms_topic, total.published / elapsed);
+        return;
+    }
+
+    spdlog::info("load generator ran for {:.2f} s: published {} ({:.1f} Hz per node, {:.1f} Hz requested), "
+                 "received {}, dropped {}",
+        elapsed, total.published, total.published / elapsed / num_nodes, publish_rate, total.received,
+        total.dropped);
+    spdlog::info("load generator latency [ms]: p50 {:.3f}, p90 {:.3f}, p99 {:.3f}, max {:.3f}",
+        1000.0 * total.latencies.percentile(0.5), 1000.0 * total.latencies.percentile(0.9),
+        1000.0 * total.latencies.percentile(0.99), 1000.0 * total.latencies.percentile(1.0));
+}
+}
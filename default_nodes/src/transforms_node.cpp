@@ -1,16 +1,28 @@
 #include <transforms_node.hpp>
 
 #include <eigen3/Eigen/Geometry>
+#include <string_view>
 #include <unordered_set>
 
-#include <rachel_utils.hpp>
-
 namespace transforms_node {
-void canonical_frame_order(std::string& frame1, std::string& frame2)
+/*
+    Returns the two frames ordered so that the smaller one comes first, without copying them
+*/
+std::pair<std::string_view, std::string_view> canonical_frame_order(std::string_view frame1, std::string_view frame2)
 {
     if (frame2 < frame1) {
-        std::swap(frame1, frame2);
+        return { frame2, frame1 };
     }
+    return { frame1, frame2 };
+}
+
+std::size_t hash_frames(std::string_view frame1, std::string_view frame2)
+{
+    const auto [A, B] = canonical_frame_order(frame1, frame2);
+
+    std::size_t h1 = std::hash<std::string_view> {}(A);
+    std::size_t h2 = std::hash<std::string_view> {}(B);
+    return h1 ^ (h2 << 1);
 }
 
 /*
@@ -23,11 +35,21 @@ struct TransformKey {
 
     bool operator==(const TransformKey& t) const noexcept
     {
-        std::string A = t.frame1, B = t.frame2, C = frame1, D = frame2;
-        canonical_frame_order(A, B);
-        canonical_frame_order(C, D);
+        return (frame1 == t.frame1 && frame2 == t.frame2) || (frame1 == t.frame2 && frame2 == t.frame1);
+    }
+};
+
+/*
+    Non-owning version of TransformKey, used as the key of the stored transforms. Stored keys view the frame names of
+    the transform they belong to, and lookups view the frame names they are given, so looking up a transform never
+    copies any frame names.
+*/
+struct TransformKeyView {
+    std::string_view frame1, frame2;
 
-        return (A == C) && (B == D);
+    bool operator==(const TransformKeyView& t) const noexcept
+    {
+        return (frame1 == t.frame1 && frame2 == t.frame2) || (frame1 == t.frame2 && frame2 == t.frame1);
     }
 };
 }
@@ -36,12 +58,15 @@ template <>
 struct std::hash<transforms_node::TransformKey> {
     std::size_t operator()(const transforms_node::TransformKey& t) const noexcept
     {
-        std::string A = t.frame1, B = t.frame2;
-        transforms_node::canonical_frame_order(A, B);
+        return transforms_node::hash_frames(t.frame1, t.frame2);
+    }
+};
 
-        std::size_t h1 = std::hash<std::string> {}(A);
-        std::size_t h2 = std::hash<std::string> {}(B);
-        return h1 ^ (h2 << 1);
+template <>
+struct std::hash<transforms_node::TransformKeyView> {
+    std::size_t operator()(const transforms_node::TransformKeyView& t) const noexcept
+    {
+        return transforms_node::hash_frames(t.frame1, t.frame2);
     }
 };
 
@@ -93,6 +118,11 @@ public:
         return transform;
     }
 
+    void set_transform(const Isometry& new_transform)
+    {
+        transform = new_transform;
+    }
+
     /*
         Directly multiplying the transform with a vector only works on transforming points.
         When transforming vectors that represents directions, use this function instead.
@@ -108,10 +138,26 @@ public:
     }
 };
 
-std::unordered_map<TransformKey, TransformObj> transforms;
+/*
+    A stored transform, together with the latest update received for it during the current cycle. Updates are only
+    written to `pending` while they arrive, and committed to `current` all at once at the end of the cycle, so that
+    lookups always see a consistent set of transforms.
+*/
+struct Edge {
+    TransformObj current;
+    Isometry pending;
+    bool dirty = false;
+};
+
+// Edges are kept behind pointers so that the frame names viewed by their keys never move
+std::unordered_map<TransformKeyView, std::unique_ptr<Edge>> transforms;
 std::unordered_map<std::string, std::vector<std::string>> neighbors;
 std::unordered_map<TransformKey, std::vector<std::string>> paths_cache;
 
+// The map never erases edges, so these pointers stay valid
+std::vector<Edge*> dirty_edges;
+std::vector<TransformUpdate> new_edges;
+
 void add_transform(const std::string& source, const std::string& target, const Isometry& transform)
 {
     // This check could be skipped in a release build
@@ -119,16 +165,70 @@ void add_transform(const std::string& source, const std::string& target, const I
         throw std::runtime_error("Cannot add transform from and to the same frame");
     }
 
-    TransformKey k;
-    k.frame1 = source;
-    k.frame2 = target;
-    transforms[k] = TransformObj(source, target, transform);
+    const auto it = transforms.find({ source, target });
+    if (it != transforms.end()) {
+        // Existing edge, possibly given in the opposite direction
+        TransformObj& obj = it->second->current;
+        obj.set_transform(obj.get_source() == source ? transform : transform.inverse());
+        return;
+    }
+
+    auto edge = std::make_unique<Edge>();
+    edge->current = TransformObj(source, target, transform);
+    const TransformObj& obj = edge->current;
+    transforms.emplace(TransformKeyView { obj.get_source(), obj.get_target() }, std::move(edge));
 
     // Add to neighbors map
-    auto it = neighbors.try_emplace(source).first;
-    it->second.push_back(target);
-    it = neighbors.try_emplace(target).first;
-    it->second.push_back(source);
+    auto n = neighbors.try_emplace(source).first;
+    n->second.push_back(target);
+    n = neighbors.try_emplace(target).first;
+    n->second.push_back(source);
+}
+
+/*
+    Called for every received transform update. Updates of known edges only overwrite the edge's pending transform, so
+    many updates of the same edge within one cycle are coalesced into one, without copying frame names or allocating.
+*/
+void ingest_transform(const TransformUpdate& update)
+{
+    if (update.source == update.target) {
+        spdlog::warn("Ignoring transform update from and to the same frame {}", update.source);
+        return;
+    }
+
+    const auto it = transforms.find({ update.source, update.target });
+    if (it == transforms.end()) {
+        new_edges.push_back(update);
+        return;
+    }
+
+    Edge& edge = *it->second;
+    edge.pending = edge.current.get_source() == update.source ? update.transform : update.transform.inverse();
+    if (!edge.dirty) {
+        edge.dirty = true;
+        dirty_edges.push_back(&edge);
+    }
+}
+
+/*
+    Commits all updates received since the last call. Returns the number of edges that were updated or added.
+*/
+size_t apply_transform_updates()
+{
+    const size_t num_updated = dirty_edges.size() + new_edges.size();
+
+    for (Edge* edge : dirty_edges) {
+        edge->current.set_transform(edge->pending);
+        edge->dirty = false;
+    }
+    dirty_edges.clear();
+
+    for (const TransformUpdate& update : new_edges) {
+        add_transform(update.source, update.target, update.transform);
+    }
+    new_edges.clear();
+
+    return num_updated;
 }
 
 bool _find_transform_path(const std::string& source, const std::string& target, std::vector<std::string>& visited_order, std::unordered_set<std::string> all_visited)
@@ -201,8 +301,7 @@ bool find_transform(const std::string& source, const std::string& target, Isomet
     bool success = find_transform_path(source, target, order);
 
     out.setIdentity();
-    TransformKey key;
-    key.frame1 = source;
+    TransformKeyView key { source, {} };
     for (const std::string& frame : order) {
         key.frame2 = frame;
         auto it = transforms.find(key);
@@ -213,8 +312,9 @@ bool find_transform(const std::string& source, const std::string& target, Isomet
             return false;
         }
 
-        Isometry T = it->second.get_transform();
-        if (it->second.get_source() == frame) {
+        const TransformObj& obj = it->second->current;
+        Isometry T = obj.get_transform();
+        if (obj.get_source() == frame) {
             // Opposite order, invert
             T = T.inverse();
         }
@@ -226,27 +326,60 @@ bool find_transform(const std::string& source, const std::string& target, Isomet
     return success;
 }
 
-void TransformsNode::run(const nlohmann::json& params)
-{
-    add_transform("base", "arm", Isometry::Identity());
-    add_transform("arm", "hand", Isometry::Identity());
-    add_transform("base", "leg", Isometry::Identity());
-    add_transform("leg", "foot", Isometry::Identity());
-    add_transform("base", "head", Isometry::Identity());
-    add_transform("hand", "finger", Isometry::Identity());
+TransformsNode transforms_node("transforms_node");
 
-    // Update one transform
-    Isometry some_transform = Isometry::Identity();
-    some_transform.rotate(Eigen::AngleAxisd(0.12, Eigen::Vector3d::UnitY()));
-    some_transform.translate(Eigen::Vector3d(0.1, 0.2, 0.3));
-    add_transform("foot", "leg", some_transform);
+const std::string TOPICS_PARAM = transforms_node.param_name("~/topics");
+const std::string QUEUE_SIZE_PARAM = transforms_node.param_name("~/queue_size");
+const std::string RATE_PARAM = transforms_node.param_name("~/rate_hz");
+const std::string STATS_PERIOD_PARAM = transforms_node.param_name("~/stats_period_s");
 
-    Isometry T;
+void TransformsNode::set_default_params(nlohmann::json& params)
+{
+    params[TOPICS_PARAM] = { "/transforms" };
+    params[QUEUE_SIZE_PARAM] = 4096;
+    params[RATE_PARAM] = 100.0;
+    params[STATS_PERIOD_PARAM] = 10.0;
+}
 
-    if (find_transform("finger", "foot", T)) {
-        spdlog::info("LOLOLOLOL {}", rachel_utils::format_matrix(T.matrix()));
+void TransformsNode::run(const nlohmann::json& params)
+{
+    const size_t queue_size = params[QUEUE_SIZE_PARAM];
+    const double rate = params[RATE_PARAM];
+    const double stats_period = params[STATS_PERIOD_PARAM];
+    set_time_delta(rachel::seconds(1.0 / rate));
+
+    // Drivers publish at much higher rates than this node's loop, so the topic
+    // queues must hold all updates from one cycle
+    size_t num_received = 0;
+    for (const auto& topic_param : params[TOPICS_PARAM]) {
+        const std::string topic = topic_param.get<std::string>();
+        rachel::topics::register_publisher<TransformUpdate>(topic)->set_queue_size(queue_size);
+        subscribe<TransformUpdate>(topic, [&num_received](const TransformUpdate& update) {
+            ingest_transform(update);
+            ++num_received;
+        });
+    }
+    dirty_edges.reserve(1024);
+
+    size_t num_applied = 0;
+    size_t num_cycles = 0;
+    rachel::TimeDelta apply_time = rachel::TimeDelta::zero();
+    rachel::Time stats_start = rachel::current_time();
+
+    while (main_loop_condition()) {
+        const rachel::Time t = rachel::current_time();
+        num_applied += apply_transform_updates();
+        apply_time += rachel::current_time() - t;
+        ++num_cycles;
+
+        const double elapsed = rachel::to_seconds(rachel::current_time() - stats_start);
+        if (stats_period > 0.0 && elapsed >= stats_period) {
+            spdlog::info("{} received {:.0f} updates/s, applied {:.0f} edge updates/s, {:.2f} us per batch", node_name,
+                num_received / elapsed, num_applied / elapsed, 1e6 * rachel::to_seconds(apply_time) / num_cycles);
+            num_received = num_applied = num_cycles = 0;
+            apply_time = rachel::TimeDelta::zero();
+            stats_start = rachel::current_time();
+        }
     }
 }
-
-TransformsNode transforms_node("transforms_node");
 }
\ No newline at end of file
@@ -8,12 +8,15 @@
 #include <mutex>
 #include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include <spdlog/spdlog.h>
 
 using MutexLock = std::lock_guard<std::mutex>;
 
+#include "rachel_alloc.hpp"
 #include "rachel_params.hpp"
+#include "rachel_tasks.hpp"
 #include "rachel_topics.hpp"
 
 namespace rachel {
@@ -53,13 +56,84 @@ extern std::atomic<bool> shutdown;
 
 void capture_interrupt_signal();
 
+class Node;
+
+namespace fusion {
+    /*
+        Runs a group of fused nodes in the calling thread, see `launch_fused`.
+    */
+    void run_group(const std::vector<Node*>& nodes, const nlohmann::json& params);
+
+    /*
+        Lets the other nodes in the calling thread's group run until the given
+       time. Only valid in a fused node's thread.
+    */
+    void yield_until(const Time& t);
+}
+
+/*
+    Controls how a subscription is handled by `Node::handle_callbacks`.
+    Subscriptions are handled in a fixed order: critical ones first, then by
+   descending priority, then in the order they were subscribed. If a budget is
+   set, a queue based subscription stops calling its callback once the budget
+   is used up, and continues with the remaining values in the next cycle. A
+   warning is logged whenever a subscription goes over its budget.
+*/
+struct SubscriptionOptions {
+    int priority = 0;
+    TimeDelta budget = TimeDelta::zero();
+    bool critical = false;
+};
+
+/*
+    Replaces every `~` in a parameter name with the root of the given node, so
+   that `~/rate` becomes `/node_name/rate`.
+*/
+inline std::string expand_param_name(const std::string& node_name, std::string param_name)
+{
+    std::stringstream ss;
+    ss << "/" << node_name;
+    const std::string topic_root = ss.str();
+
+    size_t pos;
+    while ((pos = param_name.find('~')) != std::string::npos) {
+        param_name.replace(pos, 1, topic_root);
+    }
+    return param_name;
+}
+
 class Node {
 private:
-    std::unordered_map<std::string, std::function<void(void)>>
-        _subscription_updates;
+    struct SubscriptionUpdate {
+        std::string topic;
+        SubscriptionOptions options;
+        std::function<void(const Time& deadline)> update;
+        bool deferred = false;
+    };
+
+    std::vector<SubscriptionUpdate> _subscription_updates;
     std::unordered_map<std::string, std::any> _subscriptions;
     Time _last_loop_condition;
     TimeDelta _time_delta = seconds(0.1);
+    double _defer_threshold = 0.0;
+
+    size_t _loop_iterations = 0;
+    size_t _alloc_warmup = 100;
+    bool _alloc_fatal = false;
+    bool _alloc_sample_stacks = false;
+    alloc::Counters _alloc_at_loop_start;
+
+    void check_allocations();
+
+    // Whether the node's `run` is currently running in a group of fused nodes,
+    // and can therefore receive values directly from the other nodes in it
+    bool _fused_running = false;
+    friend void fusion::run_group(
+        const std::vector<Node*>& nodes, const nlohmann::json& params);
+
+    void add_subscription_update(const std::string& topic,
+        const SubscriptionOptions& options,
+        std::function<void(const Time& deadline)> update);
 
 public:
     std::string node_name;
@@ -71,15 +145,17 @@ public:
        written with the latest published value.
     */
     template <typename T>
-    void subscribe(const std::string& topic, T* data, bool* is_set)
+    void subscribe(const std::string& topic, T* data, bool* is_set,
+        const SubscriptionOptions& options = {})
     {
         _subscriptions[topic] = topics::ValueSubscription<T>(data, topic);
-        _subscription_updates[topic] = [this, topic, is_set]() {
-            auto& sub = std::any_cast<topics::ValueSubscription<T>&>(
-                _subscriptions[topic]);
-            sub.update();
-            *is_set = sub.is_set();
-        };
+        add_subscription_update(topic, options,
+            [this, topic, is_set](const Time&) {
+                auto& sub = std::any_cast<topics::ValueSubscription<T>&>(
+                    _subscriptions[topic]);
+                sub.update();
+                *is_set = sub.is_set();
+            });
     };
 
     /*
@@ -88,33 +164,71 @@ public:
     */
     template <typename T>
     void subscribe(const std::string& topic,
-        std::function<void(const T&)> callback)
+        std::function<void(const T&)> callback,
+        const SubscriptionOptions& options = {})
     {
         _subscriptions[topic] = topics::QueueSubscription<T>(topic);
-        _subscription_updates[topic] = [this, topic, callback]() {
+        if (topics::current_group) {
             auto& sub = std::any_cast<topics::QueueSubscription<T>&>(
                 _subscriptions[topic]);
-            sub.update(callback);
-        };
+            sub.deliver_directly(topics::current_group,
+                [this, callback](const T& t) {
+                    if (_fused_running) {
+                        callback(t);
+                    }
+                });
+        }
+        add_subscription_update(topic, options,
+            [this, topic, callback](const Time& deadline) {
+                auto& sub = std::any_cast<topics::QueueSubscription<T>&>(
+                    _subscriptions[topic]);
+                sub.update(callback, deadline);
+            });
     }
 
     void set_time_delta(const TimeDelta& dt);
+
+    /*
+        Once this fraction of the time delta has passed since the start of the
+       cycle, including the time spent in the node's own loop body, the
+       remaining subscriptions that are not critical are deferred to the next
+       cycle. A subscription is never deferred two cycles in a row, so every
+       subscription is handled at least every other cycle, even when the loop
+       body alone overruns the time delta. 0, the default, disables deferring.
+    */
+    void set_defer_threshold(double fraction);
+
+    /*
+        Only has an effect when built with RACHEL_ALLOC_TRACKING. After
+       `warmup_iterations` iterations of the main loop, any heap allocation made
+       by the node's thread during an iteration is reported, or throws if
+       `fatal` is set, which is useful in tests. If `sample_stacks` is set, the
+       stack trace of the first allocation in the iteration is printed as well.
+    */
+    void set_alloc_check(
+        size_t warmup_iterations, bool fatal = false, bool sample_stacks = false);
+
+    /*
+        Caps how many task pool workers this node can use at the same time, see
+       rachel_tasks.hpp. Should be called from within `run`, since it applies to
+       the calling thread.
+    */
+    void set_task_limit(size_t max_workers);
+
     virtual void handle_callbacks();
     virtual void run(const nlohmann::json& params) { };
     virtual bool main_loop_condition();
     virtual void set_default_params(nlohmann::json& params);
 
+    /*
+        Number of threads the node starts on its own, besides the thread its
+       `run` function runs in. These cores are not given to the task pool.
+    */
+    virtual size_t extra_threads(const nlohmann::json&) const { return 0; }
+
     std::string param_name(std::string param_name)
     {
-        std::stringstream ss;
-        ss << "/" << node_name;
-        const std::string topic_root = ss.str();
-
-        auto pos = param_name.find("~");
-        while ((pos = param_name.find('~')) != std::string::npos) {
-            param_name.replace(pos, 1, topic_root);
-        }
-        return param_name;
+        return expand_param_name(node_name, std::move(param_name));
     }
 };
 
@@ -123,6 +237,19 @@ public:
 */
 void launch(Node& node);
 
+/*
+    Prepares a group of nodes for launching fused: instead of one thread per
+   node, all of them run in a single thread, taking turns whenever they call
+   `main_loop_condition`. When a topic's only subscriber is in the same group as
+   the publisher, publishing calls the subscriber's callback directly instead
+   of going through the topic queue, so values are passed on without copying or
+   waiting for the subscriber's next loop. This is intended for linear
+   pipelines, e.g. a driver, a filter and a consumer, and needs no changes to
+   the nodes, but fused nodes must not block anywhere but in
+   `main_loop_condition`.
+*/
+void launch_fused(const std::vector<Node*>& nodes);
+
 /*
     Starts all node threads. Waits for all nodes to finish. Typically called
    near the end of the main function.
@@ -0,0 +1,40 @@
+#pragma once
+#include <cstddef>
+
+namespace rachel {
+namespace alloc {
+    /*
+        Heap allocation counting, which is only active when RACHEL is built with
+       the CMake option RACHEL_ALLOC_TRACKING. It replaces the global `operator
+       new` and `operator delete` with versions that count allocations per
+       thread, which `Node::main_loop_condition` uses to attribute allocations to
+       each iteration of a node's main loop.
+    */
+    struct Counters {
+        size_t count = 0;
+        size_t bytes = 0;
+    };
+
+    /*
+        Allocations counted on the calling thread since it started
+    */
+    Counters thread_counters();
+
+    /*
+        Stops counting allocations on the calling thread while paused, so that
+       e.g. reporting allocations does not count itself
+    */
+    void pause(bool paused);
+
+    /*
+        While armed, a stack trace is recorded for the first counted allocation
+       on the calling thread. Arming again discards the previous stack trace.
+    */
+    void arm_stack_sample(bool armed);
+
+    /*
+        Prints the recorded stack trace, if any, to stderr. Does not allocate.
+    */
+    void print_stack_sample();
+}
+}
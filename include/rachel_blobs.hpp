@@ -0,0 +1,152 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <nlohmann/json.hpp>
+
+namespace rachel {
+namespace blobs {
+    /*
+        A read-only, memory-mapped binary file. The mapping starts on a page
+       boundary, so the data can be viewed directly as any type with an
+       alignment requirement of up to a page, e.g. as an `Eigen::Map` with
+       `Eigen::Aligned16` or as a typed array through `as`.
+    */
+    class Blob {
+    private:
+        const std::byte* ptr = nullptr;
+        size_t length = 0;
+        std::string file;
+
+    public:
+        Blob(const std::string& path)
+            : file(path)
+        {
+            const int fd = ::open(path.c_str(), O_RDONLY);
+            if (fd < 0) {
+                std::stringstream ss;
+                ss << "Failed to open blob file " << path;
+                throw std::runtime_error(ss.str());
+            }
+
+            struct stat st;
+            if (::fstat(fd, &st) != 0) {
+                ::close(fd);
+                std::stringstream ss;
+                ss << "Failed to read size of blob file " << path;
+                throw std::runtime_error(ss.str());
+            }
+            length = static_cast<size_t>(st.st_size);
+
+            // mmap does not accept empty mappings, an empty blob simply has no
+            // data
+            if (length > 0) {
+                void* p = ::mmap(nullptr, length, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (p == MAP_FAILED) {
+                    ::close(fd);
+                    std::stringstream ss;
+                    ss << "Failed to memory map blob file " << path;
+                    throw std::runtime_error(ss.str());
+                }
+                ptr = static_cast<const std::byte*>(p);
+            }
+
+            // The mapping stays valid after the file descriptor is closed
+            ::close(fd);
+        }
+
+        Blob(const Blob&) = delete;
+        Blob& operator=(const Blob&) = delete;
+
+        ~Blob()
+        {
+            if (ptr) {
+                ::munmap(const_cast<std::byte*>(ptr), length);
+            }
+        }
+
+        const std::byte* data() const { return ptr; }
+        size_t size() const { return length; }
+        const std::string& path() const { return file; }
+
+        /*
+            Number of elements of type T in the blob.
+        */
+        template <typename T>
+        size_t count() const
+        {
+            return length / sizeof(T);
+        }
+
+        /*
+            Views the blob as an array of `count<T>()` elements of type T. Throws
+           if the size of the blob is not a multiple of the size of T.
+        */
+        template <typename T>
+        const T* as() const
+        {
+            if (length % sizeof(T) != 0) {
+                std::stringstream ss;
+                ss << "Blob file " << file << " has " << length << " bytes, which is not a multiple of "
+                   << sizeof(T) << " bytes";
+                throw std::runtime_error(ss.str());
+            }
+            return reinterpret_cast<const T*>(ptr);
+        }
+    };
+
+    inline std::unordered_map<std::string, std::unique_ptr<Blob>> blobs;
+    inline std::mutex blobs_mutex;
+    inline std::filesystem::path base_directory;
+
+    /*
+        Relative blob paths are resolved against this directory, which is set
+       to the directory of the parameters file when it is loaded.
+    */
+    inline void set_base_directory(const std::filesystem::path& dir)
+    {
+        const MutexLock lock(blobs_mutex);
+        base_directory = dir;
+    }
+
+    /*
+        Returns the blob referenced by a parameter value of the form
+       `{"blob": "path/to/file.bin"}`. The file is mapped the first time it is
+       requested, and all later requests, from any node, share the same mapping.
+       The returned reference stays valid until the program exits.
+    */
+    inline const Blob& get(const nlohmann::json& param)
+    {
+        if (!param.is_object() || !param.contains("blob")) {
+            std::stringstream ss;
+            ss << "Parameter " << param.dump() << " is not a blob reference, expected {\"blob\": \"<path>\"}";
+            throw std::runtime_error(ss.str());
+        }
+
+        std::filesystem::path path = param["blob"].get<std::string>();
+
+        const MutexLock lock(blobs_mutex);
+        if (path.is_relative() && !base_directory.empty()) {
+            path = base_directory / path;
+        }
+
+        const std::string key = path.lexically_normal().string();
+        auto found = blobs.find(key);
+        if (found == blobs.end()) {
+            found = blobs.emplace(key, std::make_unique<Blob>(key)).first;
+        }
+        return *found->second;
+    }
+}
+}
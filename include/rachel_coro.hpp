@@ -0,0 +1,246 @@
+#pragma once
+
+#if __cplusplus < 202002L
+#error "rachel_coro.hpp requires C++20, link against the rachel_coro target"
+#endif
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <tuple>
+
+#include "rachel.hpp"
+
+namespace rachel {
+namespace coro {
+    /*
+        Return type of coroutine nodes' `run` functions. The coroutine does not
+       start until it is handed to the scheduler, which then owns it.
+    */
+    class Task {
+    public:
+        struct promise_type;
+        using handle_t = std::coroutine_handle<promise_type>;
+
+        /*
+            Reports to the scheduler when the coroutine has finished, which then
+           destroys it
+        */
+        struct FinalAwaiter {
+            bool await_ready() noexcept { return false; }
+            void await_suspend(handle_t h) noexcept;
+            void await_resume() noexcept { }
+        };
+
+        struct promise_type {
+            std::string name;
+            std::exception_ptr error;
+
+            Task get_return_object() { return Task(handle_t::from_promise(*this)); }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            FinalAwaiter final_suspend() noexcept { return {}; }
+            void return_void() { }
+            void unhandled_exception() { error = std::current_exception(); }
+        };
+
+        Task(Task&& t) noexcept
+            : handle(t.release())
+        {
+        }
+        Task(const Task&) = delete;
+        Task& operator=(const Task&) = delete;
+
+        ~Task()
+        {
+            if (handle) {
+                handle.destroy();
+            }
+        }
+
+        handle_t release() { return std::exchange(handle, nullptr); }
+
+    private:
+        handle_t handle;
+
+        Task(handle_t h)
+            : handle(h)
+        {
+        }
+    };
+
+    /*
+        Hands a coroutine to the scheduler. It will be started the next time a
+       scheduler thread is free.
+    */
+    void spawn(const std::string& name, Task task);
+
+    /*
+        Parks a suspended coroutine until `ready` returns true or the deadline
+       has passed. Either of them may be left empty. Used by the awaiters below.
+    */
+    void suspend(std::coroutine_handle<> h, std::function<bool(void)> ready, std::optional<Time> deadline);
+
+    /*
+        Awaiter that suspends until a condition is true or a deadline has passed.
+       If the condition is already true, the coroutine continues without
+       suspending.
+    */
+    struct WaitAwaiter {
+        std::function<bool(void)> ready;
+        std::optional<Time> deadline;
+
+        bool await_ready() { return (ready && ready()) || (deadline && current_time() >= *deadline); }
+        void await_suspend(std::coroutine_handle<> h) { suspend(h, ready, deadline); }
+        void await_resume() { }
+    };
+
+    inline WaitAwaiter sleep_until(const Time& t) { return WaitAwaiter { nullptr, t }; }
+    inline WaitAwaiter sleep_for(const TimeDelta& dt) { return sleep_until(current_time() + dt); }
+
+    /*
+        Coroutine counterpart of a queue based subscription. Awaiting `next`
+       gives the values published on the topic one at a time, in order, skipping
+       values that left the topic queue before they were read.
+    */
+    template <typename T>
+    class Subscription {
+    private:
+        topics::topic_ptr<T> p;
+        topics::seq_t seq = 0;
+
+        struct NextAwaiter : WaitAwaiter {
+            Subscription* sub;
+            T await_resume()
+            {
+                T out;
+                sub->try_next(out);
+                return out;
+            }
+        };
+
+        struct NextWithTimeoutAwaiter : WaitAwaiter {
+            Subscription* sub;
+            std::optional<T> await_resume()
+            {
+                T out;
+                if (sub->try_next(out)) {
+                    return out;
+                }
+                return std::nullopt;
+            }
+        };
+
+    public:
+        Subscription(const std::string& topic)
+            : p(topics::find_topic<T>(topic))
+        {
+            p->add_subscriber();
+        }
+
+        bool has_next() { return p->has_newer(seq); }
+        bool try_next(T& out) { return p->take_next(seq, out); }
+
+        /*
+            Waits for the next value
+        */
+        NextAwaiter next()
+        {
+            return NextAwaiter { { [this]() { return has_next(); }, std::nullopt }, this };
+        }
+
+        /*
+            Waits for the next value, giving up with an empty optional after the
+           timeout
+        */
+        NextWithTimeoutAwaiter next(const TimeDelta& timeout)
+        {
+            return NextWithTimeoutAwaiter { { [this]() { return has_next(); }, current_time() + timeout }, this };
+        }
+    };
+
+    template <typename... Subs>
+    size_t first_ready(std::tuple<Subs&...>& subs)
+    {
+        size_t index = sizeof...(Subs);
+        size_t i = 0;
+        std::apply([&](auto&... s) { ((index == sizeof...(Subs) && s.has_next() ? index = i : 0, ++i), ...); }, subs);
+        return index;
+    }
+
+    template <typename... Subs>
+    struct AnyOfAwaiter : WaitAwaiter {
+        std::tuple<Subs&...> subs;
+        std::optional<size_t> await_resume()
+        {
+            const size_t index = first_ready(subs);
+            if (index < sizeof...(Subs)) {
+                return index;
+            }
+            return std::nullopt;
+        }
+    };
+
+    /*
+        Waits until any of the subscriptions has a new value, and gives the
+       index of the first one that does. The value itself is then obtained with
+       `try_next` on that subscription. Gives an empty optional if the timeout
+       passes first.
+    */
+    template <typename... Subs>
+    AnyOfAwaiter<Subs...> any_of(const TimeDelta& timeout, Subs&... subs)
+    {
+        AnyOfAwaiter<Subs...> a { {}, std::tie(subs...) };
+        a.ready = [subs = a.subs]() mutable { return first_ready(subs) < sizeof...(Subs); };
+        a.deadline = current_time() + timeout;
+        return a;
+    }
+
+    /*
+        Base class for coroutine based nodes. Instead of a blocking loop in a
+       thread of its own, `run` is a coroutine which is resumed by a small pool
+       of scheduler threads shared by all coroutine nodes. Coroutine nodes are
+       launched with `rachel::coro::launch` and run by `scheduler_node`, which
+       must itself be launched as a normal node.
+    */
+    class CoroNode {
+    public:
+        std::string node_name;
+
+        CoroNode(const std::string& name)
+            : node_name(name)
+        {
+        }
+        virtual ~CoroNode() = default;
+
+        virtual Task run(const nlohmann::json& params) = 0;
+        virtual void set_default_params(nlohmann::json&) { }
+
+        std::string param_name(std::string param_name)
+        {
+            return expand_param_name(node_name, std::move(param_name));
+        }
+    };
+
+    /*
+        Prepares a coroutine node for launching by the scheduler node.
+    */
+    void launch(CoroNode& node);
+
+    /*
+        Runs all launched coroutine nodes on `/coro_scheduler/threads` threads,
+       one of which is this node's own thread. Coroutines waiting for topics or
+       deadlines are checked every `/coro_scheduler/tick_us` microseconds. The
+       node finishes when all coroutines have finished, or at shutdown, in which
+       case coroutines that are still suspended are destroyed.
+    */
+    class SchedulerNode : public Node {
+    public:
+        using Node::Node;
+        void run(const nlohmann::json& params) override;
+        void set_default_params(nlohmann::json& params) override;
+        size_t extra_threads(const nlohmann::json& params) const override;
+    };
+
+    extern SchedulerNode scheduler_node;
+}
+}
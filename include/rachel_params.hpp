@@ -6,6 +6,8 @@
 
 #include <nlohmann/json.hpp>
 
+#include "rachel_blobs.hpp"
+
 namespace rachel {
 using param_t = const nlohmann::json;
 
@@ -20,6 +22,10 @@ using param_t = const nlohmann::json;
    function, and then overwritten by a JSON file, if it exists. The file is
    searched for in whatever path is provided in the environment variable
    `RACHEL_PARAMS_FILE`, or else the default location `/etc/rachel/params.json`.
+
+    Large read-only data should not be stored in the JSON file itself. Instead,
+   a parameter can reference a binary file as `{"blob": "path/to/file.bin"}`,
+   which is memory mapped on demand through `blobs::get`.
 */
 class Parameters {
 private:
@@ -56,6 +62,7 @@ public:
         if (file.is_open()) {
             nlohmann::json new_data = nlohmann::json::parse(file);
             params.update(new_data, true);
+            blobs::set_base_directory(std::filesystem::absolute(file_location).parent_path());
         } else if (!accept_file_not_found) {
             std::stringstream ss;
             ss << "Environment variable RACHEL_PARAMS_FILE specified that "
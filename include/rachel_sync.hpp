@@ -0,0 +1,196 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+
+#include "rachel.hpp"
+
+namespace rachel {
+namespace sync {
+    /*
+        Synchronized topics carry shared pointers to immutable messages, so that
+       matching and emitting them never copies the messages themselves
+    */
+    template <typename T>
+    using msg_ptr = std::shared_ptr<const T>;
+
+    /*
+        Subscribes to one topic per message type and calls the callback with
+       tuples of messages, one from each topic, whose timestamps are all within
+       `tolerance` of each other. Each message type must have a `stamp` member of
+       type `rachel::Time`, and each topic is expected to be published in
+       timestamp order.
+
+        The topics must be of type `msg_ptr<T>`. Matching uses a sliding window
+       over the buffered messages of each topic: the newest of the oldest
+       buffered messages is the pivot, anything too old to ever match it is
+       discarded, and the message closest to the pivot is picked from each
+       topic, as long as it is within the tolerance of the messages already
+       picked. Matches are emitted as soon as every topic has a candidate, so a
+       later message that would have been slightly closer is not waited for.
+
+        Every topic buffers at most `queue_size` messages, dropping the oldest
+       when full, so memory stays bounded when one stream stalls. The callback
+       runs in the owning node's thread as part of its normal subscription
+       callbacks. The synchronizer must outlive its subscriptions, and so it
+       cannot be moved.
+    */
+    template <typename... Ts>
+    class ApproximateTimeSynchronizer {
+    public:
+        using Callback = std::function<void(const msg_ptr<Ts>&...)>;
+        static constexpr size_t N = sizeof...(Ts);
+
+    private:
+        std::tuple<std::deque<msg_ptr<Ts>>...> queues;
+        TimeDelta tolerance;
+        Callback callback;
+        size_t queue_size;
+        size_t num_dropped = 0;
+        size_t num_unmatched = 0;
+
+        template <size_t... I>
+        void subscribe_all(Node& node, const std::array<std::string, N>& topics, std::index_sequence<I...>)
+        {
+            (node.subscribe<msg_ptr<Ts>>(
+                 topics[I], [this](const msg_ptr<Ts>& m) { add<I>(m); }),
+                ...);
+        }
+
+        template <size_t I, typename T>
+        void add(const msg_ptr<T>& m)
+        {
+            auto& q = std::get<I>(queues);
+            q.push_back(m);
+            if (q.size() > queue_size) {
+                q.pop_front();
+                ++num_dropped;
+            }
+            match();
+        }
+
+        bool any_empty()
+        {
+            return std::apply([](auto&... q) { return (q.empty() || ...); }, queues);
+        }
+
+        /*
+            Discards messages older than the tolerance window around the pivot.
+           Returns true if anything was discarded.
+        */
+        bool discard_older_than(const Time& t)
+        {
+            bool discarded = false;
+            std::apply(
+                [&](auto&... q) {
+                    (
+                        [&](auto& queue) {
+                            while (!queue.empty() && queue.front()->stamp < t) {
+                                queue.pop_front();
+                                ++num_unmatched;
+                                discarded = true;
+                            }
+                        }(q),
+                        ...);
+                },
+                queues);
+            return discarded;
+        }
+
+        /*
+            Index of the message closest to the pivot among those with a
+           timestamp in [lo, hi]
+        */
+        template <typename Q>
+        static size_t closest(const Q& q, const Time& pivot, const Time& lo, const Time& hi)
+        {
+            size_t best = 0;
+            TimeDelta best_diff = TimeDelta::max();
+            for (size_t i = 0; i < q.size() && q[i]->stamp <= hi; ++i) {
+                if (q[i]->stamp < lo) {
+                    continue;
+                }
+                const TimeDelta diff = q[i]->stamp > pivot ? q[i]->stamp - pivot : pivot - q[i]->stamp;
+                if (diff < best_diff) {
+                    best = i;
+                    best_diff = diff;
+                }
+            }
+            return best;
+        }
+
+        /*
+            Picks one message from each topic in turn. Every pick is at most the
+           tolerance older than the newest pick so far, and at most the
+           tolerance newer than the oldest front message, which no pick can be
+           older than. The emitted messages are therefore all within the
+           tolerance of each other, and every topic's front message is always a
+           valid pick.
+        */
+        template <size_t... I>
+        void emit(const Time& pivot, const Time& oldest_front, std::index_sequence<I...>)
+        {
+            Time newest = pivot;
+            std::array<size_t, N> picked;
+            (
+                [&](auto& q) {
+                    picked[I] = closest(q, pivot, newest - tolerance, oldest_front + tolerance);
+                    newest = std::max(newest, q[picked[I]]->stamp);
+                }(std::get<I>(queues)),
+                ...);
+            callback(std::get<I>(queues)[picked[I]]...);
+
+            // Everything up to the emitted messages is done with, and the
+            // skipped messages will never be matched
+            num_unmatched += (picked[I] + ...);
+            (std::get<I>(queues).erase(std::get<I>(queues).begin(),
+                 std::get<I>(queues).begin() + picked[I] + 1),
+                ...);
+        }
+
+        void match()
+        {
+            while (!any_empty()) {
+                const Time pivot = std::apply([](auto&... q) { return std::max({ q.front()->stamp... }); }, queues);
+
+                // Messages older than this can never be matched with the
+                // pivot or anything after it
+                if (discard_older_than(pivot - tolerance)) {
+                    continue;
+                }
+
+                const Time oldest_front = std::apply([](auto&... q) { return std::min({ q.front()->stamp... }); }, queues);
+                emit(pivot, oldest_front, std::index_sequence_for<Ts...> {});
+            }
+        }
+
+    public:
+        ApproximateTimeSynchronizer(Node& node, const std::array<std::string, N>& topics, const TimeDelta& tolerance,
+            Callback callback, size_t queue_size = 10)
+            : tolerance(tolerance)
+            , callback(callback)
+            , queue_size(std::max<size_t>(1, queue_size))
+        {
+            subscribe_all(node, topics, std::index_sequence_for<Ts...> {});
+        }
+
+        ApproximateTimeSynchronizer(const ApproximateTimeSynchronizer&) = delete;
+        ApproximateTimeSynchronizer& operator=(const ApproximateTimeSynchronizer&) = delete;
+
+        /*
+            Number of messages dropped because a topic's buffer was full
+        */
+        size_t dropped() const { return num_dropped; }
+
+        /*
+            Number of messages discarded because no match was found for them
+        */
+        size_t unmatched() const { return num_unmatched; }
+    };
+}
+}
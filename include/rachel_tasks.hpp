@@ -0,0 +1,176 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace rachel {
+namespace tasks {
+    /*
+        RACHEL runs each node in its own thread. For data-parallel work inside a
+       node, there is a process-wide work-stealing thread pool, sized to the
+       cores that are not already used by node threads. It is started by
+       `rachel::start` before the nodes and stopped after they have all
+       finished. If there are no cores to spare, the pool has no workers and all
+       tasks simply run on the calling thread.
+    */
+    void start_pool(size_t num_workers);
+    void stop_pool();
+    size_t num_workers();
+
+    /*
+        Hands a task to the pool. Most code should use `TaskGroup`,
+       `parallel_for` or `parallel_reduce` instead, which keep track of when
+       the work is done.
+    */
+    void submit(std::function<void(void)> task);
+
+    /*
+        Caps how many pool workers can work for the calling thread at the same
+       time, so that one node cannot starve the others. Zero means no cap. This
+       is a per-thread setting, typically set through `Node::set_task_limit` at
+       the start of `run`.
+    */
+    void set_concurrency_limit(size_t max_workers);
+    size_t concurrency_limit();
+
+    /*
+        The cap set by `set_concurrency_limit`. It is shared by all task groups
+       created by the thread that set it, and by the tasks they run, so that
+       nested use of the pool from within tasks counts towards the same cap.
+    */
+    struct ConcurrencyLimit {
+        size_t max_workers = 0;
+        std::atomic<size_t> workers { 0 };
+    };
+
+    /*
+        A set of tasks that can be waited for together. At most `max_workers`
+       pool workers run tasks from the group at the same time, zero meaning no
+       cap other than the concurrency limit of the creating thread, and the thread
+       calling `wait` runs tasks too instead of just blocking. The first
+       exception thrown by a task is rethrown by `wait`.
+    */
+    class TaskGroup {
+    private:
+        /*
+            Kept behind a shared pointer since pool workers may still hold on
+           to it for a short while after the group is done
+        */
+        struct State {
+            std::mutex mutex;
+            std::condition_variable cv;
+            std::deque<std::function<void(void)>> work;
+            size_t unfinished = 0;
+            size_t runners = 0;
+            size_t max_runners = 0;
+            std::shared_ptr<ConcurrencyLimit> limit;
+            std::exception_ptr error;
+        };
+        std::shared_ptr<State> state;
+
+        static bool run_next(State& s);
+        static void drain(std::shared_ptr<State> s);
+
+    public:
+        TaskGroup();
+        TaskGroup(size_t max_workers);
+        TaskGroup(const TaskGroup&) = delete;
+        TaskGroup& operator=(const TaskGroup&) = delete;
+        ~TaskGroup();
+
+        void run(std::function<void(void)> task);
+        void wait();
+    };
+
+    /*
+        Number of indices per task when no grain size is given. Aims for a few
+       tasks per available thread, so that work stealing can even out uneven
+       tasks.
+    */
+    inline size_t default_grain(size_t n)
+    {
+        const size_t chunks = 4 * (num_workers() + 1);
+        return std::max<size_t>(1, (n + chunks - 1) / chunks);
+    }
+
+    /*
+        Calls f(i) for every i in [begin, end), spread over the pool. Returns
+       when all calls have finished.
+    */
+    template <typename F>
+    void parallel_for(size_t begin, size_t end, F&& f, size_t grain = 0)
+    {
+        if (end <= begin) {
+            return;
+        }
+
+        const size_t n = end - begin;
+        if (grain == 0) {
+            grain = default_grain(n);
+        }
+
+        if (n <= grain || num_workers() == 0) {
+            for (size_t i = begin; i < end; ++i) {
+                f(i);
+            }
+            return;
+        }
+
+        TaskGroup group;
+        for (size_t b = begin; b < end; b += grain) {
+            const size_t e = std::min(end, b + grain);
+            group.run([&f, b, e]() {
+                for (size_t i = b; i < e; ++i) {
+                    f(i);
+                }
+            });
+        }
+        group.wait();
+    }
+
+    /*
+        Combines f(i) for every i in [begin, end) using `combine`, starting from
+       `identity`. The combination order is fixed, so the result is
+       deterministic as long as `combine` is associative.
+    */
+    template <typename T, typename F, typename C>
+    T parallel_reduce(size_t begin, size_t end, T identity, F&& f, C&& combine, size_t grain = 0)
+    {
+        if (end <= begin) {
+            return identity;
+        }
+
+        const size_t n = end - begin;
+        if (grain == 0) {
+            grain = default_grain(n);
+        }
+
+        const size_t num_chunks = (n + grain - 1) / grain;
+        std::vector<T> partials(num_chunks, identity);
+        parallel_for(
+            0, num_chunks,
+            [&](size_t c) {
+                const size_t b = begin + c * grain;
+                const size_t e = std::min(end, b + grain);
+                T acc = identity;
+                for (size_t i = b; i < e; ++i) {
+                    acc = combine(acc, f(i));
+                }
+                partials[c] = acc;
+            },
+            1);
+
+        T result = identity;
+        for (const T& p : partials) {
+            result = combine(result, p);
+        }
+        return result;
+    }
+}
+}
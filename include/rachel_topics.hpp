@@ -1,39 +1,124 @@
 #pragma once
+#include <algorithm>
 #include <any>
-#include <deque>
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <sstream>
 #include <string>
 #include <unordered_map>
+#include <vector>
 
 namespace rachel {
 namespace topics {
     using seq_t = size_t;
+    using deadline_t = std::chrono::steady_clock::time_point;
+
+    /*
+        Identifies the group of fused nodes that runs on the calling thread, or
+       null if the thread is not running fused nodes. See `rachel::launch_fused`.
+    */
+    inline thread_local const void* current_group = nullptr;
 
     template <typename T>
     class Topic {
     private:
-        std::deque<T> queue;
+        /*
+            The queue is a ring buffer, which grows up to the queue size and
+           then overwrites its oldest value in place. This way publishing does
+           not allocate once the queue is full, other than what copying T itself
+           needs.
+        */
+        std::vector<T> queue;
+        size_t oldest = 0;
         size_t queue_size = 4;
         seq_t newest_seq_in_queue = 0;
         std::mutex mutex;
 
+        /*
+            When the only subscriber of the topic is a fused node, values
+           published from the same group of fused nodes are passed directly to
+           its callback instead of going through the queue
+        */
+        size_t num_subscribers = 0;
+        std::function<void(const T&)> direct_sink;
+        std::atomic<const void*> direct_group { nullptr };
+
+        /*
+            The i:th oldest value in the queue
+        */
+        T& at(size_t i) { return queue[(oldest + i) % queue.size()]; }
+
+        template <typename U>
+        void push(U&& t)
+        {
+            const MutexLock lock(mutex);
+            if (queue.size() < queue_size) {
+                queue.push_back(std::forward<U>(t));
+            } else {
+                queue[oldest] = std::forward<U>(t);
+                oldest = (oldest + 1) % queue.size();
+            }
+            ++newest_seq_in_queue;
+        }
+
+        bool publishes_directly() const
+        {
+            const void* group = direct_group.load(std::memory_order_acquire);
+            return group != nullptr && group == current_group;
+        }
+
     public:
-        Topic() { newest_seq_in_queue = 0; };
+        Topic()
+        {
+            newest_seq_in_queue = 0;
+            queue.reserve(queue_size);
+        };
 
         /*
             Updates the internal state of the topic to a new piece of data, which
            will propagate to subscribers
         */
         void publish(const T& t)
+        {
+            if (publishes_directly()) {
+                direct_sink(t);
+                return;
+            }
+            push(t);
+        }
+
+        void publish(T&& t)
+        {
+            if (publishes_directly()) {
+                direct_sink(t);
+                return;
+            }
+            push(std::move(t));
+        }
+
+        void add_subscriber()
         {
             const MutexLock lock(mutex);
-            queue.push_back(t);
-            ++newest_seq_in_queue;
+            ++num_subscribers;
+            if (num_subscribers > 1) {
+                direct_group.store(nullptr, std::memory_order_release);
+            }
+        }
 
-            while (queue.size() > queue_size) {
-                queue.pop_front();
+        /*
+            Called by a queue subscriber running in a group of fused nodes. As
+           long as it stays the only subscriber, values published from the same
+           group are passed straight to the callback.
+        */
+        void set_direct_sink(const void* group, const std::function<void(const T&)>& cb)
+        {
+            const MutexLock lock(mutex);
+            if (num_subscribers == 1 && !direct_sink) {
+                direct_sink = cb;
+                direct_group.store(group, std::memory_order_release);
             }
         }
 
@@ -50,7 +135,7 @@ namespace topics {
 
             if (newest_seq_in_queue > seq_num) {
                 seq_num = newest_seq_in_queue;
-                t = queue.back();
+                t = at(queue.size() - 1);
                 is_set = true;
             }
         }
@@ -58,9 +143,11 @@ namespace topics {
         /*
             A subscriber can call this to perform a callback function on each value
            with a newer sequence number than what they had stored. This also updates
-           said sequence number.
+           said sequence number. If the deadline passes, the remaining values are
+           left for the next call.
         */
-        void perform_callbacks(seq_t& s, std::function<void(const T&)>& cb)
+        void perform_callbacks(seq_t& s, const std::function<void(const T&)>& cb,
+            const deadline_t& deadline = deadline_t::max())
         {
             const MutexLock lock(mutex);
 
@@ -77,21 +164,65 @@ namespace topics {
             */
 
             const size_t N = qs - std::min(newest_seq_in_queue - s, qs);
-            for (auto it = queue.begin() + N; it != queue.end(); ++it) {
-                cb(*it);
+            const bool has_deadline = deadline != deadline_t::max();
+            for (size_t i = N; i < qs; ++i) {
+                cb(at(i));
+
+                if (has_deadline && i + 1 < qs
+                    && std::chrono::steady_clock::now() >= deadline) {
+                    s = newest_seq_in_queue - (qs - 1 - i);
+                    return;
+                }
             }
             s = newest_seq_in_queue;
         }
 
         /*
-            Modifies the queue size. This does not directly affect any values
-           currently in the queue. If the queue size is reduced, values will get
-           removed on the next time a new value is published.
+            Whether a value with a newer sequence number than s is available
+        */
+        bool has_newer(const seq_t& s)
+        {
+            const MutexLock lock(mutex);
+            return s < newest_seq_in_queue && queue.size() > 0;
+        }
+
+        /*
+            Copies the oldest value that is newer than sequence number s and still
+           in the queue, and advances s to the sequence number of that value.
+           Returns false if there is no such value.
+        */
+        bool take_next(seq_t& s, T& out)
+        {
+            const MutexLock lock(mutex);
+
+            const size_t qs = queue.size();
+            if (s >= newest_seq_in_queue || qs == 0) {
+                return false;
+            }
+
+            const seq_t oldest_seq_in_queue = newest_seq_in_queue - qs + 1;
+            const seq_t next = std::max(s + 1, oldest_seq_in_queue);
+            out = at(qs - 1 - (newest_seq_in_queue - next));
+            s = next;
+            return true;
+        }
+
+        /*
+            Modifies the queue size. If the queue size is reduced, the oldest
+           values are removed right away.
         */
         void set_queue_size(const size_t& new_queue_size)
         {
             const MutexLock lock(mutex);
-            queue_size = new_queue_size;
+            queue_size = std::max<size_t>(1, new_queue_size);
+
+            // Restore the order before resizing
+            std::rotate(queue.begin(), queue.begin() + oldest, queue.end());
+            oldest = 0;
+            if (queue.size() > queue_size) {
+                queue.erase(queue.begin(), queue.end() - queue_size);
+            }
+            queue.reserve(queue_size);
         }
     };
 
@@ -164,6 +295,7 @@ namespace topics {
             , topic_name(topic)
         {
             p = find_topic<T>(topic_name);
+            p->add_subscriber();
         };
 
         void update() { p->update(*t, seq, has_been_set); }
@@ -183,11 +315,18 @@ namespace topics {
             : topic_name(topic)
         {
             p = find_topic<T>(topic_name);
+            p->add_subscriber();
+        }
+
+        void update(const std::function<void(const T&)>& callback,
+            const deadline_t& deadline = deadline_t::max())
+        {
+            p->perform_callbacks(seq, callback, deadline);
         }
 
-        void update(std::function<void(const T&)> callback)
+        void deliver_directly(const void* group, const std::function<void(const T&)>& callback)
         {
-            p->perform_callbacks(seq, callback);
+            p->set_direct_sink(group, callback);
         }
     };
 }
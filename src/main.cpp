@@ -1,3 +1,4 @@
+#include "load_generator_node.hpp"
 #include "other_node.hpp"
 #include "some_node.hpp"
 #include "transforms_node.hpp"
@@ -10,6 +11,10 @@ int main()
     rachel::launch(other_node);
     rachel::launch(transforms_node::transforms_node);
 
+    // Uncomment to stress test the system with synthetic nodes, see
+    // docs/load_generator.md
+    // rachel::launch(load_generator_node::load_generator_node);
+
     rachel::start();
 
     spdlog::info("rachel done!");
@@ -1,5 +1,7 @@
 #include "rachel.hpp"
+#include <algorithm>
 #include <signal.h>
+#include <unordered_set>
 
 namespace rachel {
 std::atomic<bool> shutdown { false };
@@ -12,15 +14,115 @@ Node::Node(const std::string& name)
     _last_loop_condition = current_time();
 }
 
+void Node::add_subscription_update(const std::string& topic,
+    const SubscriptionOptions& options,
+    std::function<void(const Time& deadline)> update)
+{
+    // Subscribing to the same topic again replaces the old subscription
+    auto it = std::find_if(_subscription_updates.begin(),
+        _subscription_updates.end(),
+        [&topic](const SubscriptionUpdate& u) { return u.topic == topic; });
+    if (it != _subscription_updates.end()) {
+        _subscription_updates.erase(it);
+    }
+    _subscription_updates.push_back({ topic, options, update });
+
+    // Stable, so that equal priorities keep the subscription order
+    std::stable_sort(_subscription_updates.begin(), _subscription_updates.end(),
+        [](const SubscriptionUpdate& a, const SubscriptionUpdate& b) {
+            if (a.options.critical != b.options.critical) {
+                return a.options.critical;
+            }
+            return a.options.priority > b.options.priority;
+        });
+}
+
 void Node::handle_callbacks()
 {
-    for (const auto& sub : _subscription_updates) {
-        sub.second();
+    const Time defer_time = _defer_threshold > 0.0
+        ? _last_loop_condition
+            + std::chrono::duration_cast<TimeDelta>(
+                _time_delta * _defer_threshold)
+        : Time::max();
+
+    size_t num_deferred = 0;
+    for (auto& sub : _subscription_updates) {
+        const Time start = current_time();
+        if (!sub.options.critical && !sub.deferred && start >= defer_time) {
+            sub.deferred = true;
+            ++num_deferred;
+            continue;
+        }
+        sub.deferred = false;
+
+        const TimeDelta& budget = sub.options.budget;
+        if (budget <= TimeDelta::zero()) {
+            sub.update(Time::max());
+            continue;
+        }
+
+        sub.update(start + budget);
+        const auto elapsed = current_time() - start;
+        if (elapsed > budget) {
+            spdlog::warn("{} took {:.4f} s on {} out of {:.4f} s budget",
+                node_name, to_seconds(elapsed), sub.topic, to_seconds(budget));
+        }
+    }
+
+    if (num_deferred > 0) {
+        spdlog::debug("{} deferred {} subscriptions to the next cycle",
+            node_name, num_deferred);
     }
 }
 
 void Node::set_time_delta(const TimeDelta& dt) { _time_delta = dt; }
 
+void Node::set_defer_threshold(double fraction) { _defer_threshold = fraction; }
+
+void Node::set_alloc_check(
+    size_t warmup_iterations, bool fatal, bool sample_stacks)
+{
+    _alloc_warmup = warmup_iterations;
+    _alloc_fatal = fatal;
+    _alloc_sample_stacks = sample_stacks;
+}
+
+void Node::check_allocations()
+{
+    ++_loop_iterations;
+#ifdef RACHEL_ALLOC_TRACKING
+    const alloc::Counters now = alloc::thread_counters();
+    const size_t count = now.count - _alloc_at_loop_start.count;
+    const size_t bytes = now.bytes - _alloc_at_loop_start.bytes;
+
+    if (_loop_iterations > _alloc_warmup && count > 0) {
+        alloc::pause(true);
+        spdlog::warn("{} made {} heap allocations ({} bytes) in loop iteration {}",
+            node_name, count, bytes, _loop_iterations);
+        if (_alloc_sample_stacks) {
+            alloc::print_stack_sample();
+        }
+        alloc::pause(false);
+
+        if (_alloc_fatal) {
+            std::stringstream ss;
+            ss << node_name << " made " << count
+               << " heap allocations in loop iteration " << _loop_iterations
+               << ", after the warm-up of " << _alloc_warmup << " iterations";
+            throw std::runtime_error(ss.str());
+        }
+    }
+
+    alloc::arm_stack_sample(
+        _alloc_sample_stacks && _loop_iterations >= _alloc_warmup);
+#endif
+}
+
+void Node::set_task_limit(size_t max_workers)
+{
+    tasks::set_concurrency_limit(max_workers);
+}
+
 bool Node::main_loop_condition()
 {
     if (shutdown) {
@@ -28,19 +130,32 @@ bool Node::main_loop_condition()
     }
 
     handle_callbacks();
+    check_allocations();
 
     const auto elapsed = current_time() - _last_loop_condition;
     const auto remaining = _time_delta - elapsed;
 
     if (remaining > TimeDelta::zero()) {
-        std::this_thread::sleep_for(remaining);
+        // Fused nodes let the other nodes in their thread run instead of
+        // sleeping
+        if (topics::current_group) {
+            fusion::yield_until(_last_loop_condition + _time_delta);
+        } else {
+            std::this_thread::sleep_for(remaining);
+        }
         spdlog::debug("{} took {:.4f} s out of {:.4f} s budget", node_name,
             to_seconds(elapsed), to_seconds(_time_delta));
     } else {
+        if (topics::current_group) {
+            fusion::yield_until(current_time());
+        }
         spdlog::warn("{} took {:.4f} s out of {:.4f} s budget", node_name,
             to_seconds(elapsed), to_seconds(_time_delta));
     }
     _last_loop_condition = current_time();
+#ifdef RACHEL_ALLOC_TRACKING
+    _alloc_at_loop_start = alloc::thread_counters();
+#endif
     return true;
 }
 
@@ -56,8 +171,15 @@ void capture_interrupt_signal()
 }
 
 std::vector<Node*> launched_nodes;
+std::vector<std::vector<Node*>> fused_groups;
 void launch(Node& node) { launched_nodes.push_back(&node); }
 
+void launch_fused(const std::vector<Node*>& nodes)
+{
+    launched_nodes.insert(launched_nodes.end(), nodes.begin(), nodes.end());
+    fused_groups.push_back(nodes);
+}
+
 void start()
 {
     // Load all default parameters
@@ -80,17 +202,48 @@ void start()
     _params.finalize();
     auto params = _params.get();
 
+    // The task pool gets the cores that are not used by node threads, unless
+    // the number of workers is set explicitly
+    const int task_threads = params->is_object()
+        ? params->value("/rachel/task_threads", -1)
+        : -1;
+    std::unordered_set<Node*> fused_nodes;
+    for (const auto& group : fused_groups) {
+        fused_nodes.insert(group.begin(), group.end());
+    }
+    size_t num_node_threads
+        = launched_nodes.size() - fused_nodes.size() + fused_groups.size();
+    for (Node* node : launched_nodes) {
+        num_node_threads += node->extra_threads(*params);
+    }
+    const size_t num_cores = std::thread::hardware_concurrency();
+    const size_t num_workers = task_threads >= 0
+        ? static_cast<size_t>(task_threads)
+        : (num_cores > num_node_threads ? num_cores - num_node_threads : 0);
+    tasks::start_pool(num_workers);
+    spdlog::info("Started task pool with {} workers, {} node threads on {} cores",
+        num_workers, num_node_threads, num_cores);
+
     // Start the threads
     std::vector<std::thread> threads;
     for (Node* node : launched_nodes) {
+        if (fused_nodes.count(node) > 0) {
+            continue;
+        }
         spdlog::info("Starting node: {}", node->node_name);
         threads.push_back(
             std::thread([node, params]() { node->run(*params); }));
     }
+    for (const auto& group : fused_groups) {
+        threads.push_back(std::thread(
+            [&group, params]() { fusion::run_group(group, *params); }));
+    }
 
     // Wait for them to finish
     for (auto& t : threads) {
         t.join();
     }
+
+    tasks::stop_pool();
 }
 }
\ No newline at end of file
@@ -0,0 +1,119 @@
+#include "rachel_alloc.hpp"
+
+#include <cstdlib>
+#include <new>
+
+#include <execinfo.h>
+#include <unistd.h>
+
+namespace rachel {
+namespace alloc {
+    namespace {
+        constexpr int max_stack_depth = 32;
+
+        // Only trivial types, so that no allocation or initialization code is
+        // needed to access them from within operator new
+        thread_local Counters counters;
+        thread_local bool paused = false;
+        thread_local bool armed = false;
+        thread_local int stack_depth = 0;
+        thread_local void* stack[max_stack_depth];
+
+        void count(size_t size)
+        {
+            if (paused) {
+                return;
+            }
+
+            ++counters.count;
+            counters.bytes += size;
+
+            if (armed && stack_depth == 0) {
+                // backtrace may allocate the first time it is called
+                paused = true;
+                stack_depth = backtrace(stack, max_stack_depth);
+                paused = false;
+            }
+        }
+
+        void* allocate(size_t size)
+        {
+            count(size);
+            return std::malloc(size > 0 ? size : 1);
+        }
+
+        void* allocate_aligned(size_t size, std::align_val_t al)
+        {
+            count(size);
+            const size_t alignment = static_cast<size_t>(al);
+            // aligned_alloc requires the size to be a multiple of the alignment
+            const size_t rounded = (size + alignment - 1) / alignment * alignment;
+            return std::aligned_alloc(alignment, rounded > 0 ? rounded : alignment);
+        }
+
+        void* checked(void* p)
+        {
+            if (!p) {
+                throw std::bad_alloc();
+            }
+            return p;
+        }
+    }
+
+    Counters thread_counters() { return counters; }
+
+    void pause(bool p) { paused = p; }
+
+    void arm_stack_sample(bool a)
+    {
+        if (a && !armed) {
+            // Makes sure backtrace has done its one-time setup
+            void* dummy[1];
+            paused = true;
+            backtrace(dummy, 1);
+            paused = false;
+        }
+        armed = a;
+        stack_depth = 0;
+    }
+
+    void print_stack_sample()
+    {
+        if (stack_depth > 0) {
+            backtrace_symbols_fd(stack, stack_depth, STDERR_FILENO);
+        }
+    }
+}
+}
+
+using rachel::alloc::allocate;
+using rachel::alloc::allocate_aligned;
+using rachel::alloc::checked;
+
+void* operator new(size_t size) { return checked(allocate(size)); }
+void* operator new[](size_t size) { return checked(allocate(size)); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return allocate(size); }
+void* operator new(size_t size, std::align_val_t al) { return checked(allocate_aligned(size, al)); }
+void* operator new[](size_t size, std::align_val_t al) { return checked(allocate_aligned(size, al)); }
+void* operator new(size_t size, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+    return allocate_aligned(size, al);
+}
+void* operator new[](size_t size, std::align_val_t al, const std::nothrow_t&) noexcept
+{
+    return allocate_aligned(size, al);
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, size_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t) noexcept { std::free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { std::free(p); }
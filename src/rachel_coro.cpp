@@ -0,0 +1,201 @@
+#include "rachel_coro.hpp"
+
+#include <deque>
+
+namespace rachel {
+namespace coro {
+    namespace {
+        struct Waiting {
+            std::coroutine_handle<> handle;
+            std::function<bool(void)> ready;
+            std::optional<Time> deadline;
+        };
+
+        /*
+            Suspended coroutines wait in `waiting` until a scheduler thread
+           finds that they can continue, and then in `runnable` until a
+           scheduler thread is free to resume them
+        */
+        std::mutex scheduler_mutex;
+        std::vector<Waiting> waiting;
+        std::deque<std::coroutine_handle<>> runnable;
+        std::atomic<size_t> alive { 0 };
+
+        // The first exception that escaped a coroutine node, which stops the
+        // scheduler and is rethrown by `SchedulerNode::run`
+        std::exception_ptr error;
+        std::atomic<bool> failed { false };
+
+        std::vector<CoroNode*> launched_coro_nodes;
+
+        /*
+            Moves all waiting coroutines that can continue to `runnable`. The
+           readiness checks take topic locks, so they are made without holding
+           the scheduler lock. The coroutines are taken out of `waiting` while
+           they are checked, so no other thread touches them meanwhile.
+        */
+        void poll_waiting(std::vector<Waiting>& polled, std::vector<Waiting>& still_waiting,
+            std::vector<std::coroutine_handle<>>& ready)
+        {
+            {
+                const MutexLock lock(scheduler_mutex);
+                std::swap(polled, waiting);
+            }
+
+            const Time now = current_time();
+            for (Waiting& w : polled) {
+                if ((w.deadline && now >= *w.deadline) || (w.ready && w.ready())) {
+                    ready.push_back(w.handle);
+                } else {
+                    still_waiting.push_back(std::move(w));
+                }
+            }
+
+            {
+                const MutexLock lock(scheduler_mutex);
+                waiting.insert(waiting.end(), std::make_move_iterator(still_waiting.begin()),
+                    std::make_move_iterator(still_waiting.end()));
+                runnable.insert(runnable.end(), ready.begin(), ready.end());
+            }
+            polled.clear();
+            still_waiting.clear();
+            ready.clear();
+        }
+
+        bool take_runnable(std::coroutine_handle<>& h)
+        {
+            const MutexLock lock(scheduler_mutex);
+            if (runnable.empty()) {
+                return false;
+            }
+            h = runnable.front();
+            runnable.pop_front();
+            return true;
+        }
+
+        void scheduler_loop(TimeDelta tick)
+        {
+            // Kept between ticks so that polling does not allocate
+            std::vector<Waiting> polled, still_waiting;
+            std::vector<std::coroutine_handle<>> ready;
+
+            while (!shutdown && !failed && alive > 0) {
+                poll_waiting(polled, still_waiting, ready);
+
+                // Handles must not be touched after resuming them, since
+                // another thread may already be resuming or destroying them
+                bool resumed = false;
+                std::coroutine_handle<> h;
+                while (take_runnable(h)) {
+                    h.resume();
+                    resumed = true;
+                }
+
+                if (!resumed) {
+                    std::this_thread::sleep_for(tick);
+                }
+            }
+        }
+    }
+
+    void Task::FinalAwaiter::await_suspend(handle_t h) noexcept
+    {
+        if (h.promise().error) {
+            spdlog::error("{} stopped with an exception", h.promise().name);
+            const MutexLock lock(scheduler_mutex);
+            if (!error) {
+                error = h.promise().error;
+            }
+            failed = true;
+        } else {
+            spdlog::info("{} finished", h.promise().name);
+        }
+
+        h.destroy();
+        --alive;
+    }
+
+    void spawn(const std::string& name, Task task)
+    {
+        auto h = task.release();
+        h.promise().name = name;
+
+        ++alive;
+        const MutexLock lock(scheduler_mutex);
+        waiting.push_back(Waiting { h, nullptr, current_time() });
+    }
+
+    void suspend(std::coroutine_handle<> h, std::function<bool(void)> ready, std::optional<Time> deadline)
+    {
+        const MutexLock lock(scheduler_mutex);
+        waiting.push_back(Waiting { h, std::move(ready), deadline });
+    }
+
+    void launch(CoroNode& node) { launched_coro_nodes.push_back(&node); }
+
+    SchedulerNode scheduler_node("coro_scheduler");
+
+    const std::string THREADS_PARAM = scheduler_node.param_name("~/threads");
+    const std::string TICK_PARAM = scheduler_node.param_name("~/tick_us");
+
+    void SchedulerNode::set_default_params(nlohmann::json& params)
+    {
+        params[THREADS_PARAM] = 2;
+        params[TICK_PARAM] = 1000.0;
+
+        // Coroutine nodes are not launched as normal nodes, so their default
+        // parameters are collected here
+        for (CoroNode* node : launched_coro_nodes) {
+            node->set_default_params(params);
+        }
+    }
+
+    size_t SchedulerNode::extra_threads(const nlohmann::json& params) const
+    {
+        return std::max<size_t>(1, params[THREADS_PARAM].get<size_t>()) - 1;
+    }
+
+    void SchedulerNode::run(const nlohmann::json& params)
+    {
+        const size_t num_threads = std::max<size_t>(1, params[THREADS_PARAM].get<size_t>());
+        const TimeDelta tick = microseconds(params[TICK_PARAM].get<double>());
+
+        for (CoroNode* node : launched_coro_nodes) {
+            spdlog::info("Starting coroutine node: {}", node->node_name);
+            spawn(node->node_name, node->run(params));
+        }
+
+        std::vector<std::thread> threads;
+        for (size_t i = 1; i < num_threads; ++i) {
+            threads.push_back(std::thread(scheduler_loop, tick));
+        }
+        scheduler_loop(tick);
+
+        for (auto& t : threads) {
+            t.join();
+        }
+
+        // At shutdown, any coroutines still waiting are destroyed, which runs
+        // the destructors of their local variables
+        const MutexLock lock(scheduler_mutex);
+        if (!waiting.empty() || !runnable.empty()) {
+            spdlog::info("Destroying {} suspended coroutines", waiting.size() + runnable.size());
+        }
+        for (auto& w : waiting) {
+            w.handle.destroy();
+        }
+        for (auto h : runnable) {
+            h.destroy();
+        }
+        waiting.clear();
+        runnable.clear();
+        alive = 0;
+
+        // Ends the program just like an exception escaping the `run` of a
+        // normal node would
+        if (error) {
+            std::rethrow_exception(std::exchange(error, nullptr));
+        }
+    }
+}
+}
@@ -0,0 +1,180 @@
+#include "rachel.hpp"
+
+#include <sys/mman.h>
+#include <ucontext.h>
+#include <unistd.h>
+
+namespace rachel {
+namespace fusion {
+    namespace {
+        /*
+            A fiber's stack, with a guard page below it so that overflowing it
+           crashes right away instead of corrupting whatever memory is next to
+           it. Pages are only committed once used, so large stacks are cheap.
+        */
+        class Stack {
+        private:
+            char* base = nullptr;
+            size_t mapped_size = 0;
+            size_t guard_size = 0;
+
+        public:
+            Stack() = default;
+            Stack(const Stack&) = delete;
+            Stack& operator=(const Stack&) = delete;
+
+            ~Stack()
+            {
+                if (base) {
+                    munmap(base, mapped_size);
+                }
+            }
+
+            void allocate(size_t size)
+            {
+                guard_size = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+                size = (size + guard_size - 1) / guard_size * guard_size;
+                mapped_size = size + guard_size;
+
+                void* p = mmap(nullptr, mapped_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+                if (p == MAP_FAILED) {
+                    throw std::runtime_error("Could not allocate stack for fused node");
+                }
+                base = static_cast<char*>(p);
+
+                // Stacks grow downwards
+                if (mprotect(base, guard_size, PROT_NONE) != 0) {
+                    throw std::runtime_error("Could not protect stack of fused node");
+                }
+            }
+
+            void* bottom() const { return base + guard_size; }
+            size_t size() const { return mapped_size - guard_size; }
+        };
+
+        /*
+            Each fused node runs its `run` function on a stack of its own, and
+           switches back to the group's scheduler whenever it waits in
+           `main_loop_condition`
+        */
+        struct Fiber {
+            Node* node;
+            ucontext_t context;
+            Stack stack;
+            Time wake;
+            bool done = false;
+            std::exception_ptr error;
+        };
+
+        struct Group {
+            std::vector<Fiber> fibers;
+            ucontext_t scheduler_context;
+            Fiber* current = nullptr;
+            const nlohmann::json* params = nullptr;
+        };
+
+        thread_local Group* group = nullptr;
+
+        void fiber_entry()
+        {
+            Fiber& fiber = *group->current;
+            try {
+                fiber.node->run(*group->params);
+            } catch (...) {
+                // Exceptions cannot propagate past the start of the fiber's
+                // stack, so the scheduler rethrows them instead
+                fiber.error = std::current_exception();
+            }
+            fiber.done = true;
+
+            // Returning continues in `uc_link`, which is the scheduler
+        }
+    }
+
+    void run_group(const std::vector<Node*>& nodes, const nlohmann::json& params)
+    {
+        // Nodes may have large local variables, so by default fused nodes
+        // get as much stack as a thread would
+        const size_t stack_size = 1024
+            * (params.is_object() ? params.value("/rachel/fused_stack_kib", 8192) : 8192);
+
+        Group g;
+        g.params = &params;
+        g.fibers = std::vector<Fiber>(nodes.size());
+
+        const Time now = current_time();
+        for (size_t i = 0; i < nodes.size(); ++i) {
+            Fiber& f = g.fibers[i];
+            f.node = nodes[i];
+            f.stack.allocate(stack_size);
+            f.wake = now;
+
+            getcontext(&f.context);
+            f.context.uc_stack.ss_sp = f.stack.bottom();
+            f.context.uc_stack.ss_size = f.stack.size();
+            f.context.uc_link = &g.scheduler_context;
+            makecontext(&f.context, fiber_entry, 0);
+        }
+
+        group = &g;
+        topics::current_group = &g;
+
+        std::stringstream names;
+        for (Node* node : nodes) {
+            names << " " << node->node_name;
+        }
+        spdlog::info("Starting fused nodes:{}", names.str());
+
+        // Until their `run` returns, nodes can receive values directly from
+        // the others, even while they are not the one currently running
+        for (Node* node : nodes) {
+            node->_fused_running = true;
+        }
+
+        while (true) {
+            // Runs the node that should wake up first
+            Fiber* next = nullptr;
+            for (Fiber& f : g.fibers) {
+                if (!f.done && (!next || f.wake < next->wake)) {
+                    next = &f;
+                }
+            }
+            if (!next) {
+                break;
+            }
+
+            // At shutdown, nodes should get to return from
+            // `main_loop_condition` right away
+            if (!shutdown && next->wake > current_time()) {
+                std::this_thread::sleep_until(next->wake);
+            }
+
+            g.current = next;
+            swapcontext(&g.scheduler_context, &next->context);
+            if (next->done) {
+                next->node->_fused_running = false;
+            }
+
+            // Ends the program just like an exception escaping the `run` of a
+            // node in a thread of its own would
+            if (next->error) {
+                spdlog::error("{} stopped with an exception", next->node->node_name);
+                group = nullptr;
+                topics::current_group = nullptr;
+                std::rethrow_exception(next->error);
+            }
+        }
+
+        group = nullptr;
+        topics::current_group = nullptr;
+    }
+
+    void yield_until(const Time& t)
+    {
+        Fiber& f = *group->current;
+        f.wake = t;
+        swapcontext(&f.context, &group->scheduler_context);
+    }
+}
+}
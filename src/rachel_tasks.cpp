@@ -0,0 +1,301 @@
+#include "rachel.hpp"
+
+namespace rachel {
+namespace tasks {
+    namespace {
+        /*
+            Each worker has its own queue. The owner takes the newest task from
+           the back, while other threads steal the oldest tasks from the front.
+        */
+        struct WorkerQueue {
+            std::mutex mutex;
+            std::deque<std::function<void(void)>> tasks;
+        };
+
+        std::vector<std::unique_ptr<WorkerQueue>> queues;
+        std::vector<std::thread> workers;
+        std::atomic<size_t> pending { 0 };
+        std::atomic<size_t> next_queue { 0 };
+        std::atomic<bool> stopping { false };
+        std::mutex sleep_mutex;
+        std::condition_variable sleep_cv;
+
+        thread_local int worker_index = -1;
+        thread_local std::shared_ptr<ConcurrencyLimit> limit;
+
+        /*
+            Takes one of the limit's workers, if there are any left
+        */
+        bool acquire_worker(ConcurrencyLimit* l)
+        {
+            if (!l) {
+                return true;
+            }
+
+            size_t workers = l->workers;
+            while (workers < l->max_workers) {
+                if (l->workers.compare_exchange_weak(workers, workers + 1)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void release_worker(ConcurrencyLimit* l)
+        {
+            if (l) {
+                --l->workers;
+            }
+        }
+
+        bool try_pop(WorkerQueue& q, bool from_back, std::function<void(void)>& out)
+        {
+            const MutexLock lock(q.mutex);
+            if (q.tasks.empty()) {
+                return false;
+            }
+
+            if (from_back) {
+                out = std::move(q.tasks.back());
+                q.tasks.pop_back();
+            } else {
+                out = std::move(q.tasks.front());
+                q.tasks.pop_front();
+            }
+            return true;
+        }
+
+        bool take_task(std::function<void(void)>& out)
+        {
+            const size_t n = queues.size();
+            if (n == 0) {
+                return false;
+            }
+
+            size_t first = 0;
+            if (worker_index >= 0) {
+                if (try_pop(*queues[worker_index], true, out)) {
+                    return true;
+                }
+                first = worker_index + 1;
+            }
+
+            for (size_t i = 0; i < n; ++i) {
+                if (try_pop(*queues[(first + i) % n], false, out)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void worker_loop(int index)
+        {
+            worker_index = index;
+            std::function<void(void)> task;
+            while (!stopping) {
+                if (take_task(task)) {
+                    --pending;
+                    task();
+                    task = nullptr;
+                    continue;
+                }
+
+                std::unique_lock<std::mutex> lock(sleep_mutex);
+                sleep_cv.wait(lock, []() { return pending > 0 || stopping; });
+            }
+        }
+    }
+
+    void start_pool(size_t num_workers)
+    {
+        stopping = false;
+        for (size_t i = 0; i < num_workers; ++i) {
+            queues.push_back(std::make_unique<WorkerQueue>());
+        }
+        for (size_t i = 0; i < num_workers; ++i) {
+            workers.push_back(std::thread(worker_loop, static_cast<int>(i)));
+        }
+    }
+
+    void stop_pool()
+    {
+        {
+            const MutexLock lock(sleep_mutex);
+            stopping = true;
+        }
+        sleep_cv.notify_all();
+
+        for (auto& t : workers) {
+            t.join();
+        }
+        workers.clear();
+        queues.clear();
+        pending = 0;
+    }
+
+    size_t num_workers() { return workers.size(); }
+
+    void submit(std::function<void(void)> task)
+    {
+        const size_t n = queues.size();
+        if (n == 0) {
+            task();
+            return;
+        }
+
+        // Counted before it can be taken, so that `pending` never wraps
+        // around when a worker takes the task right away
+        ++pending;
+        const size_t index = worker_index >= 0 ? worker_index : next_queue++ % n;
+        {
+            const MutexLock lock(queues[index]->mutex);
+            queues[index]->tasks.push_back(std::move(task));
+        }
+
+        {
+            // Taking the lock makes sure a worker cannot miss the wakeup
+            // between checking `pending` and going to sleep
+            const MutexLock lock(sleep_mutex);
+        }
+        sleep_cv.notify_one();
+    }
+
+    void set_concurrency_limit(size_t max_workers)
+    {
+        if (max_workers == 0) {
+            limit = nullptr;
+            return;
+        }
+        limit = std::make_shared<ConcurrencyLimit>();
+        limit->max_workers = max_workers;
+    }
+
+    size_t concurrency_limit() { return limit ? limit->max_workers : 0; }
+
+    TaskGroup::TaskGroup()
+        : TaskGroup(0)
+    {
+    }
+
+    TaskGroup::TaskGroup(size_t max_workers)
+        : state(std::make_shared<State>())
+    {
+        state->max_runners = max_workers;
+        state->limit = limit;
+    }
+
+    TaskGroup::~TaskGroup()
+    {
+        try {
+            wait();
+        } catch (const std::exception& e) {
+            spdlog::error("Unhandled exception in task group: {}", e.what());
+        }
+    }
+
+    bool TaskGroup::run_next(State& s)
+    {
+        std::function<void(void)> task;
+        {
+            const MutexLock lock(s.mutex);
+            if (s.work.empty()) {
+                return false;
+            }
+            task = std::move(s.work.front());
+            s.work.pop_front();
+        }
+
+        // Tasks count towards the limit of the thread that created the group,
+        // also when they use the pool themselves
+        std::shared_ptr<ConcurrencyLimit> caller_limit = std::exchange(limit, s.limit);
+        std::exception_ptr error;
+        try {
+            task();
+        } catch (...) {
+            error = std::current_exception();
+        }
+        limit = std::move(caller_limit);
+
+        bool done = false;
+        {
+            const MutexLock lock(s.mutex);
+            if (error && !s.error) {
+                s.error = error;
+            }
+            done = --s.unfinished == 0;
+        }
+        if (done) {
+            s.cv.notify_all();
+        }
+        return true;
+    }
+
+    void TaskGroup::drain(std::shared_ptr<State> s)
+    {
+        while (true) {
+            {
+                // Checked under the same lock as `run` checks the number of
+                // runners, so that no task is ever left without a runner
+                const MutexLock lock(s->mutex);
+                if (s->work.empty()) {
+                    --s->runners;
+                    break;
+                }
+            }
+            run_next(*s);
+        }
+        release_worker(s->limit.get());
+    }
+
+    void TaskGroup::run(std::function<void(void)> task)
+    {
+        bool spawn = false;
+        {
+            const MutexLock lock(state->mutex);
+            state->work.push_back(std::move(task));
+            ++state->unfinished;
+
+            size_t max_runners = num_workers();
+            if (state->max_runners > 0) {
+                max_runners = std::min(max_runners, state->max_runners);
+            }
+            if (state->runners < max_runners && acquire_worker(state->limit.get())) {
+                ++state->runners;
+                spawn = true;
+            }
+        }
+        state->cv.notify_all();
+
+        if (spawn) {
+            std::shared_ptr<State> s = state;
+            submit([s]() { drain(s); });
+        }
+    }
+
+    void TaskGroup::wait()
+    {
+        State& s = *state;
+        while (true) {
+            // Help out rather than just blocking
+            if (run_next(s)) {
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(s.mutex);
+            s.cv.wait(lock, [&s]() { return s.unfinished == 0 || !s.work.empty(); });
+            if (s.unfinished == 0) {
+                break;
+            }
+        }
+
+        std::exception_ptr error;
+        {
+            const MutexLock lock(s.mutex);
+            std::swap(error, s.error);
+        }
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+}
+}